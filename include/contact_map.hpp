@@ -0,0 +1,119 @@
+/*
+    read_dcd : c++ class + main file example for reading a CHARMM dcd file
+    Copyright (C) 2013  Florent Hedin
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "array_tools.hpp"
+
+#ifndef CONTACT_MAP_HPP
+#define	CONTACT_MAP_HPP
+
+/*
+ * Contact frequency map : for each pair of groups (atoms, or residues if a group index is given for each atom)
+ * counts the fraction of frames where at least one pair of atoms of the 2 groups is closer than the cutoff.
+ * Pairs of atoms of the same group are ignored.
+ * 
+ * A Verlet list of the atom pairs closer than cutoff+skin is kept between frames : it is only rebuilt (with a cell list)
+ * when the displacements of the atoms and the change of the box could have brought a pair from beyond cutoff+skin to
+ * within the cutoff (see CONTACT_MAP::needs_rebuild()). The pair list is split between threads for the counting : the
+ * threads are started once by the constructor and woken up at each frame.
+ */
+class CONTACT_MAP
+{
+
+private:
+    //private attributes
+    int NATOM;
+    int NGRP;
+    int *GRP;           // group of each atom
+    
+    float cut2;         // cutoff squared
+    float rlist;        // cutoff + skin
+    float skin;
+    
+    int nthreads;
+    
+    bool  use_pbc;
+    float box[3];       // orthorhombic box lengths, from the dcd unit cell
+    float box0[3];      // box lengths at the last build of the list
+    
+    bool  built;
+    float *X0,*Y0,*Z0;  // coordinates at the last build of the list
+    
+    // Verlet list : atom pairs sorted by group pair, so that each group pair is a contiguous run of the list
+    std::vector<int> pair_i;
+    std::vector<int> pair_j;
+    std::vector<int> run_start;            // first pair of each run, plus one past the last pair
+    std::vector<long long> run_key;        // group pair of each run : a*NGRP+b with a<b
+    std::vector<unsigned long> run_count;  // number of frames in contact since the last build ; the counters of thread t
+                                           // start at index t*PAD, so that 2 threads never write to the same cache line
+    std::vector<int> thread_run;           // first run of each thread, plus one past the last run
+    
+    std::map<long long,unsigned long> counts; // frames in contact accumulated over the previous lists (sparse)
+    
+    unsigned long nframes;
+    unsigned long nbuilds;
+    
+    // persistent worker threads : thread t (from 1 to nthreads-1) counts the runs of thread_run[t] to thread_run[t+1]
+    std::vector<std::thread> workers;
+    std::mutex pool_mtx;
+    std::condition_variable pool_start;
+    std::condition_variable pool_done;
+    unsigned long generation;   // incremented for each frame to count
+    int  pending;               // workers which did not finish the current frame
+    bool stop;
+    const float *cur_x,*cur_y,*cur_z;
+    
+    //private methods
+    bool needs_rebuild(const float x[], const float y[], const float z[]) const;
+    void build(const float x[], const float y[], const float z[]);
+    void flush();
+    void count_runs(const int t, const float x[], const float y[], const float z[]);
+    void worker_loop(const int t);
+    
+    CONTACT_MAP(const CONTACT_MAP&);            // not copyable
+    CONTACT_MAP& operator=(const CONTACT_MAP&);
+    
+public:
+    
+    // no public attributes
+    // public methods
+    // grp is an optional group index (from 0 to ngrp-1) for each of the natom atoms ; if not given each atom is its own group
+    CONTACT_MAP(const int natom, const float cutoff, const float _skin, const int grp[]=nullptr, const int ngrp=0, const int _nthreads=1);
+    
+    // pbc is the unit cell as given by DCD::getPbc() ; only orthorhombic boxes are supported.
+    // nullptr, or a cell with a length <= 0 (getPbc() of a dcd with QCRYS=0 is all zeros) means no periodic boundaries
+    void add_frame(const float x[], const float y[], const float z[], const double pbc[]=nullptr);
+    
+    void getFrequencies(std::vector<int>& a, std::vector<int>& b, std::vector<double>& freq) const;
+    void getFrequencies(ARRAY_2D<double>& freq) const;
+    
+    int getNGRP() const;
+    unsigned long getNframes() const;
+    unsigned long getNbuilds() const;
+    
+    ~CONTACT_MAP();
+
+};
+
+#endif	/* CONTACT_MAP_HPP */
+
@@ -50,6 +50,8 @@ protected:
     
     int NATOM; // Number of atoms
     
+    int NFRAMES; // Number of complete frames really stored in the file, from its size : can be less than NFILE for a truncated dcd
+    
     int LNFREAT; // Number of free (moving) atoms.
     int *FREEAT; // Array storing indexes of moving atoms.
     
@@ -65,7 +67,10 @@ protected:
 public:
     DCD();
     
+    static int count_frames(const long long fsize, const long long hdr_end, const int natom, const int lnfreat, const int qcrys);
+    
     int getNFILE() const;
+    int getNFRAMES() const;
     const float* getZ() const;
     const float* getY() const;
     const float* getX() const;
@@ -0,0 +1,113 @@
+/*
+    read_dcd : c++ class + main file example for reading a CHARMM dcd file
+    Copyright (C) 2013  Florent Hedin
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstddef>
+
+#include "dcd_r.hpp"
+
+#ifndef DCD_CACHE_HPP
+#define	DCD_CACHE_HPP
+
+/*
+ * In memory copy of the frames of a dcd, for analyses doing several passes over the same trajectory.
+ * 
+ * All the frames (or only a selection of atoms) are stored in one contiguous arena, backed by huge pages when available.
+ * If the trajectory does not fit in the memory budget, the frames are grouped in chunks and only some chunks are
+ * kept in memory : when a frame of a missing chunk is requested it is read again from the dcd file.
+ * For random access (load_frame()) it replaces the least recently used chunk. For sequential passes (read_oneFrame())
+ * it always goes to the last slot : the first nslots-1 chunks stay resident from one pass to the next, while plain
+ * LRU would evict each chunk just before it is needed again.
+ * 
+ * The iteration interface is the same as for DCD_R : read_oneFrame() then getX(), getY(), getZ().
+ * If the reader is in free atoms only mode (DCD_R::set_free_atoms_only()) only the LNFREAT free atoms are stored,
+ * in the order of FREEAT, and the selection indexes refer to that order.
+ */
+class DCD_CACHE
+{
+
+private:
+    //private attributes
+    DCD_R &dcd;     // reader on which DCD_R::read_header() was already called ; used again for reloading evicted chunks
+    
+    int NFILE;      // number of frames : NFILE of the header, limited to the complete frames really in the file
+    bool free_only; // the reader was in free atoms only mode when the cache was created
+    int NSRC;       // number of atoms available from the reader : NATOM, or LNFREAT in free atoms only mode
+    int NSEL;       // number of atoms stored per frame : NSRC or size of the selection
+    int *SEL;       // indexes (starting at 0) of the selected atoms, nullptr if all atoms are stored
+    
+    size_t frame_bytes; // bytes used by one frame in the arena : pbc then X, Y and Z of the NSEL atoms
+    
+    char  *arena;       // storage for all the slots, aligned on 64 bytes
+    char  *arena_raw;   // pointer returned by new[] when mmap is not used, arena is aligned inside it
+    size_t arena_bytes;
+    bool   arena_mmap;  // true if arena was obtained with mmap, false if with new[]
+    
+    int chunk_frames;   // number of frames per chunk
+    int nchunks;        // number of chunks of the trajectory
+    int nslots;         // number of chunks that can be kept in memory at the same time
+    
+    int *slot_chunk;            // chunk stored in each slot, -1 if empty
+    int *chunk_slot;            // slot where each chunk is stored, -1 if not in memory
+    unsigned long *slot_stamp;  // last use of each slot, for the LRU eviction
+    unsigned long clock;
+    
+    int next_file_frame;        // frame that DCD_R::read_oneFrame() will read next, avoids seeking for contiguous chunks
+    
+    int current;                // frame currently exposed by getX(), getY(), getZ()
+    const float  *X;
+    const float  *Y;
+    const float  *Z;
+    const double *pbc;
+    
+    //private methods
+    void alloc_arena();
+    void free_arena();
+    int  acquire_chunk(const int chunk, const bool sequential);
+    void expose_frame(const int frame, const bool sequential);
+    void load_chunk(const int chunk, const int slot);
+    
+    DCD_CACHE(const DCD_CACHE&);            // not copyable
+    DCD_CACHE& operator=(const DCD_CACHE&);
+    
+public:
+    
+    // no public attributes
+    // public methods
+    // sel is an optional list of nsel atom indexes starting at 0 ; budget is the maximum size of the arena in bytes
+    DCD_CACHE(DCD_R &_dcd, const size_t budget, const int sel[]=nullptr, const int nsel=0, const int _chunk_frames=64);
+    
+    void load_frame(const int frame);
+    void read_oneFrame();
+    void rewind();
+    
+    bool isResident() const;
+    int getNFILE() const;
+    int getNATOM() const;
+    int getCurrentFrame() const;
+    const float* getX() const;
+    const float* getY() const;
+    const float* getZ() const;
+    const double* getPbc() const;
+    const int* getSEL() const;
+    
+    ~DCD_CACHE();
+
+};
+
+#endif	/* DCD_CACHE_HPP */
+
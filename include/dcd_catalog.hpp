@@ -0,0 +1,83 @@
+/*
+    read_dcd : c++ class + main file example for reading a CHARMM dcd file
+    Copyright (C) 2013  Florent Hedin
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef DCD_CATALOG_HPP
+#define	DCD_CATALOG_HPP
+
+/*
+ * Header informations of one dcd file, see dcd.hpp for the meaning of the fields.
+ * NFRAMES is the number of complete frames really present, computed from the file size : it differs from NFILE
+ * if the simulation was stopped before the end or if the header was not updated.
+ */
+struct DCD_CATALOG_ENTRY
+{
+    std::string path;
+    long long size;     // file size in bytes and modification time, used for detecting modified files
+    long long mtime;
+    
+    int NATOM;
+    int NFILE;
+    int NFRAMES;
+    int NSAVC;
+    int DELTA4;
+    int QCRYS;
+    int CHARMV;
+    int FROZAT;
+    std::string TITLE;  // title lines without trailing spaces, separated by " | "
+};
+
+/*
+ * Index of the headers of many dcd files, stored as a CSV file.
+ * Only the header bytes of each file are read, by a pool of threads : each thread has at most one file open,
+ * so the number of outstanding reads is bounded by the number of threads.
+ * Updating an existing index only reads again the files whose size or modification time changed.
+ */
+class DCD_CATALOG
+{
+
+private:
+    //private attributes
+    std::map<std::string,DCD_CATALOG_ENTRY> entries;
+    
+    //private methods
+    static bool scan_header(const std::string& path, DCD_CATALOG_ENTRY& e);
+    
+public:
+    
+    // no public attributes
+    // public methods
+    DCD_CATALOG();
+    
+    bool load(const char filename[]);
+    bool save(const char filename[]) const;
+    
+    int update(const std::vector<std::string>& files, const int nthreads);
+    
+    const DCD_CATALOG_ENTRY* find(const std::string& path) const;
+    size_t size() const;
+    
+    ~DCD_CATALOG();
+
+};
+
+#endif	/* DCD_CATALOG_HPP */
+
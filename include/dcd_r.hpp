@@ -16,6 +16,8 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstring>
+
 #include "dcd.hpp"
 
 #ifndef DCD_R_HPP
@@ -25,9 +27,55 @@ class DCD_R : public DCD
 {
 
 private:
-    //no private attributes
+    //private attributes
+    char *frame_buf; // raw bytes of one frame (fortran markers included), filled with a single read per frame
+    
+    std::streamoff first_frame_pos; // file offset of the first frame, just after the header
+    
+    /*
+     * FREEAT split in contiguous runs of free atoms (copied with memcpy) and isolated atoms (gathered and scattered one by one,
+     * 16 at a time with AVX-512 when available). Indexes start at 0, src is the position in the dcd record, dst in X Y Z.
+     */
+    int  nruns;
+    int *run_src;
+    int *run_dst;
+    int *run_len;
+    int  nsingle;
+    int *single_src;
+    int *single_dst;
+    
+    bool free_only;     // if true X Y Z are not updated after the first frame, only the free atoms view is
+    float *free_buf;    // free atoms of the first frame, which stores all the atoms
+    const float *freeX; // free atoms view : coordinates of the LNFREAT free atoms of the last frame
+    const float *freeY;
+    const float *freeZ;
+    
+    void (DCD_R::*decode_frame)(); // frame decoder selected once by DCD_R::select_decoder() after the header was read
+    void (DCD_R::*first_decoder)(); // decoder for the first frame, restored by DCD_R::seek_frame(0)
+    void (DCD_R::*reselect_decoder)(); // set_decoder<NFIX> last used, for selecting again with the same NFIX
+    
     //private methods
     void alloc();
+    void select_decoder();
+    void build_scatter_runs();
+    void scatter_free(const float tmp[], float dst[]) const;
+    void gather_first_free();
+    
+    size_t frame_size(const int ncrd) const;
+    const char* unpack_record(const char *p, void *dst, const size_t bytes) const;
+    
+    /*
+     * Frame decoders : specialised at compile time on the presence of the unit cell (CRYS) and on
+     * an optional fixed number of atoms (NFIX, 0 means use the runtime NATOM).
+     *  read_frame_full  : all NATOM coordinates are stored in the frame
+     *  read_frame_first : first frame of a dcd with frozen atoms, all NATOM coordinates are stored ;
+     *                     then switches the decoder to read_frame_free for the next frames
+     *  read_frame_free  : only the LNFREAT free atoms are stored, scattered to X Y Z using FREEAT if SCATTER is true
+     */
+    template <bool CRYS, int NFIX> void read_frame_full();
+    template <bool CRYS, bool SCATTER, int NFIX> void read_frame_first();
+    template <bool CRYS, bool SCATTER, int NFIX> void read_frame_free();
+    template <int NFIX> void set_decoder();
     
 public:
     
@@ -37,11 +85,138 @@ public:
     
     void read_header();
     void read_oneFrame();
+    void seek_frame(const int frame);
+    
+    // free atoms only : X Y Z then keep the first frame and only getFreeX() getFreeY() getFreeZ() change
+    void set_free_atoms_only(const bool _free_only);
+    bool isFreeAtomsOnly() const;
+    const float* getFreeX() const;
+    const float* getFreeY() const;
+    const float* getFreeZ() const;
     void printHeader() const;
+    
+    // for small systems of known size : use decoders where the number of atoms is a compile time constant
+    template <int N> bool use_fixed_natom();
         
     ~DCD_R();
 
 };
 
+/*
+ * Reads one fortran record from the frame buffer : see DCD::checkFortranIOerror for details on the 2 markers.
+ * Returns a pointer to the first byte after the record.
+ */
+inline const char* DCD_R::unpack_record(const char *p, void *dst, const size_t bytes) const
+{
+    unsigned int fortcheck1,fortcheck2;
+    
+    memcpy(&fortcheck1,p,sizeof(unsigned int));
+    memcpy(dst,p+sizeof(unsigned int),bytes);
+    memcpy(&fortcheck2,p+sizeof(unsigned int)+bytes,sizeof(unsigned int));
+    checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
+    
+    return p+2*sizeof(unsigned int)+bytes;
+}
+
+template <bool CRYS, int NFIX>
+void DCD_R::read_frame_full()
+{
+    const int natom = (NFIX) ? NFIX : NATOM;
+    const size_t crdsiz = sizeof(float)*natom;
+    const size_t frmsiz = (CRYS ? 2*sizeof(unsigned int)+sizeof(double)*6 : 0) + 3*(2*sizeof(unsigned int)+crdsiz);
+    
+    dcdf.read(frame_buf,frmsiz);
+    
+    const char *p = frame_buf;
+    if (CRYS)
+        p = unpack_record(p,pbc,sizeof(double)*6);
+    p = unpack_record(p,X,crdsiz);
+    p = unpack_record(p,Y,crdsiz);
+    p = unpack_record(p,Z,crdsiz);
+}
+
+template <bool CRYS, bool SCATTER, int NFIX>
+void DCD_R::read_frame_first()
+{
+    read_frame_full<CRYS,NFIX>();
+    gather_first_free();
+    
+    dcd_first_read=false;
+    decode_frame = &DCD_R::read_frame_free<CRYS,SCATTER,NFIX>;
+}
+
+template <bool CRYS, bool SCATTER, int NFIX>
+void DCD_R::read_frame_free()
+{
+    unsigned int fortcheck1,fortcheck2;
+    
+    const size_t crdsiz = sizeof(float)*LNFREAT;
+    const size_t frmsiz = (CRYS ? 2*sizeof(unsigned int)+sizeof(double)*6 : 0) + 3*(2*sizeof(unsigned int)+crdsiz);
+    
+    dcdf.read(frame_buf,frmsiz);
+    
+    const char *p = frame_buf;
+    if (CRYS)
+        p = unpack_record(p,pbc,sizeof(double)*6);
+    
+    // the free atoms view points directly to the coordinates in the frame buffer
+    float *crd[3] = {X,Y,Z};
+    const float **view[3] = {&freeX,&freeY,&freeZ};
+    for(int c=0;c<3;c++)
+    {
+        memcpy(&fortcheck1,p,sizeof(unsigned int));
+        memcpy(&fortcheck2,p+sizeof(unsigned int)+crdsiz,sizeof(unsigned int));
+        checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
+        
+        const float *tmp = (const float*)(p+sizeof(unsigned int));
+        *view[c] = tmp;
+        if (SCATTER)
+            scatter_free(tmp,crd[c]);
+        
+        p += 2*sizeof(unsigned int)+crdsiz;
+    }
+}
+
+template <int NFIX>
+void DCD_R::set_decoder()
+{
+    const bool frozen = (LNFREAT != NATOM);
+    
+    reselect_decoder = &DCD_R::set_decoder<NFIX>;
+    
+    if (!frozen)
+        first_decoder = QCRYS ? &DCD_R::read_frame_full<true,NFIX> : &DCD_R::read_frame_full<false,NFIX>;
+    else if (free_only)
+        first_decoder = QCRYS ? &DCD_R::read_frame_first<true,false,NFIX> : &DCD_R::read_frame_first<false,false,NFIX>;
+    else
+        first_decoder = QCRYS ? &DCD_R::read_frame_first<true,true,NFIX> : &DCD_R::read_frame_first<false,true,NFIX>;
+    
+    decode_frame = first_decoder;
+    
+    // the first frame was already read : only the free atoms are stored from now
+    if (frozen && !dcd_first_read)
+    {
+        if (free_only)
+            decode_frame = QCRYS ? &DCD_R::read_frame_free<true,false,NFIX> : &DCD_R::read_frame_free<false,false,NFIX>;
+        else
+            decode_frame = QCRYS ? &DCD_R::read_frame_free<true,true,NFIX> : &DCD_R::read_frame_free<false,true,NFIX>;
+    }
+}
+
+/*
+ * Call after DCD_R::read_header() : if the dcd contains exactly N atoms, the frames will be decoded with
+ * N known at compile time (fully unrolled copies of the coordinates). Returns false and keeps the generic
+ * decoder otherwise.
+ */
+template <int N>
+bool DCD_R::use_fixed_natom()
+{
+    if (N != NATOM)
+        return false;
+    
+    set_decoder<N>();
+    return true;
+}
+
 #endif	/* DCD_R_HPP */
 
@@ -0,0 +1,481 @@
+/*
+ *  read_dcd : c++ class + main file example for reading a CHARMM dcd file
+ *  Copyright (C) 2013  Florent Hedin
+ *  
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "contact_map.hpp"
+
+using namespace std;
+
+namespace
+{
+    struct PAIR
+    {
+        long long key;
+        int i,j;
+        
+        bool operator<(const PAIR& o) const
+        {
+            if (key != o.key) return key < o.key;
+            if (i != o.i)     return i < o.i;
+            return j < o.j;
+        }
+    };
+    
+    inline float min_image(const float d, const float L)
+    {
+        return d - L*floorf(d/L + 0.5f);
+    }
+    
+    // unused counters between the counters of 2 threads : one cache line
+    const int PAD = 64/sizeof(unsigned long);
+}
+
+CONTACT_MAP::CONTACT_MAP(const int natom, const float cutoff, const float _skin, const int grp[], const int ngrp, const int _nthreads)
+{
+    NATOM = natom;
+    GRP = new int[NATOM];
+    
+    if (grp != nullptr && ngrp > 0)
+    {
+        for(int it=0;it<NATOM;it++)
+        {
+            if (grp[it] < 0 || grp[it] >= ngrp)
+            {
+                cerr << "Error when creating a CONTACT_MAP : group index " << grp[it] << " of atom " << it << " is not in [0," << ngrp << ")." << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        NGRP = ngrp;
+        memcpy(GRP,grp,NATOM*sizeof(int));
+    }
+    else
+    {
+        NGRP = NATOM;
+        for(int it=0;it<NATOM;it++)
+            GRP[it] = it;
+    }
+    
+    cut2 = cutoff*cutoff;
+    skin = _skin;
+    rlist = cutoff + skin;
+    
+    nthreads = (_nthreads > 0) ? _nthreads : 1;
+    thread_run.assign(nthreads+1,0);
+    run_count.assign(nthreads*PAD,0);
+    
+    use_pbc = false;
+    box[0] = box[1] = box[2] = 0.f;
+    box0[0] = box0[1] = box0[2] = 0.f;
+    
+    built = false;
+    X0 = new float[NATOM];
+    Y0 = new float[NATOM];
+    Z0 = new float[NATOM];
+    
+    nframes = 0;
+    nbuilds = 0;
+    
+    generation = 0;
+    pending = 0;
+    stop = false;
+    cur_x = cur_y = cur_z = nullptr;
+    for(int t=1;t<nthreads;t++)
+        workers.push_back(thread(&CONTACT_MAP::worker_loop,this,t));
+}
+
+/*
+ * A pair in contact now is at distance r = |dx - n.L| < cutoff for some integer vector n (n = 0 without pbc).
+ * With the coordinates and box of the last build, the same image is at most r + 2*dmax + |n.dL| away, where dmax is
+ * the largest displacement of an atom and n.dL = (n_x*dL_x, n_y*dL_y, n_z*dL_z) the change of the image vector.
+ * The pair is therefore in the list as long as 2*dmax + |n.dL| < skin. |n_d| is bounded by span_d/L_d + 1/2,
+ * span_d being the extent of the current coordinates along d (about 1 for coordinates wrapped in the box).
+ */
+bool CONTACT_MAP::needs_rebuild(const float x[], const float y[], const float z[]) const
+{
+    if (!built)
+        return true;
+    if (NATOM == 0)
+        return false;
+    
+    float dmax2 = 0.f;
+    float mn[3] = {x[0],y[0],z[0]}, mx[3] = {x[0],y[0],z[0]};
+    for(int it=0;it<NATOM;it++)
+    {
+        const float dx = x[it]-X0[it];
+        const float dy = y[it]-Y0[it];
+        const float dz = z[it]-Z0[it];
+        dmax2 = max(dmax2,dx*dx+dy*dy+dz*dz);
+        
+        mn[0] = min(mn[0],x[it]); mx[0] = max(mx[0],x[it]);
+        mn[1] = min(mn[1],y[it]); mx[1] = max(mx[1],y[it]);
+        mn[2] = min(mn[2],z[it]); mx[2] = max(mx[2],z[it]);
+    }
+    
+    float shift2 = 0.f;
+    if (use_pbc)
+    {
+        for(int d=0;d<3;d++)
+        {
+            const float nmax = floorf((mx[d]-mn[d])/box[d] + 0.5f);
+            const float s = nmax*fabsf(box[d]-box0[d]);
+            shift2 += s*s;
+        }
+    }
+    
+    return 2.f*sqrtf(dmax2) + sqrtf(shift2) >= skin;
+}
+
+/*
+ * Adds the counts of the current list to the sparse map, before the list is rebuilt.
+ */
+void CONTACT_MAP::flush()
+{
+    for(int t=0;t<nthreads;t++)
+        for(int r=thread_run[t];r<thread_run[t+1];r++)
+            if (run_count[r+t*PAD] > 0)
+                counts[ run_key[r] ] += run_count[r+t*PAD];
+}
+
+/*
+ * Builds the Verlet list with a cell list of cell size >= cutoff+skin : only the 27 neighbouring cells of each atom are searched.
+ */
+void CONTACT_MAP::build(const float x[], const float y[], const float z[])
+{
+    flush();
+    
+    const float rl2 = rlist*rlist;
+    const float *crd[3] = {x,y,z};
+    
+    // cell grid : the box if periodic, the bounding box of the atoms otherwise
+    float lo[3], len[3];
+    int nc[3];
+    for(int d=0;d<3;d++)
+    {
+        if (use_pbc)
+        {
+            lo[d] = 0.f;
+            len[d] = box[d];
+            nc[d] = (int)(len[d]/rlist);
+            // with less than 3 cells the neighbouring cells would not be distinct
+            if (nc[d] < 3)
+                nc[d] = 1;
+        }
+        else
+        {
+            lo[d] = len[d] = 0.f;
+            if (NATOM > 0)
+            {
+                float mn = crd[d][0], mx = crd[d][0];
+                for(int it=1;it<NATOM;it++)
+                {
+                    mn = min(mn,crd[d][it]);
+                    mx = max(mx,crd[d][it]);
+                }
+                lo[d] = mn;
+                len[d] = mx-mn;
+            }
+            nc[d] = max(1,(int)(len[d]/rlist));
+        }
+    }
+    
+    // avoid a huge and mostly empty grid for sparse systems
+    while ((long long)nc[0]*nc[1]*nc[2] > 2LL*NATOM+27)
+    {
+        int d = (nc[0] >= nc[1] && nc[0] >= nc[2]) ? 0 : ((nc[1] >= nc[2]) ? 1 : 2);
+        nc[d] = (use_pbc && nc[d]/2 < 3) ? 1 : max(1,nc[d]/2);
+    }
+    
+    const int ncell = nc[0]*nc[1]*nc[2];
+    vector<int> head(ncell,-1), next(NATOM,-1), cell(NATOM*3);
+    
+    for(int it=0;it<NATOM;it++)
+    {
+        int c[3];
+        for(int d=0;d<3;d++)
+        {
+            float v = crd[d][it];
+            if (use_pbc)
+                v -= len[d]*floorf(v/len[d]);
+            c[d] = (len[d] > 0.f) ? (int)((v-lo[d])/len[d]*nc[d]) : 0;
+            c[d] = min(max(c[d],0),nc[d]-1);
+            cell[3*it+d] = c[d];
+        }
+        const int ic = (c[0]*nc[1] + c[1])*nc[2] + c[2];
+        next[it] = head[ic];
+        head[ic] = it;
+    }
+    
+    vector<PAIR> pairs;
+    for(int it=0;it<NATOM;it++)
+    {
+        int rng[3];
+        for(int d=0;d<3;d++)
+            rng[d] = (nc[d] > 1) ? 1 : 0;
+        
+        for(int dx=-rng[0];dx<=rng[0];dx++)
+        for(int dy=-rng[1];dy<=rng[1];dy++)
+        for(int dz=-rng[2];dz<=rng[2];dz++)
+        {
+            int c[3] = {cell[3*it]+dx, cell[3*it+1]+dy, cell[3*it+2]+dz};
+            bool inside = true;
+            for(int d=0;d<3;d++)
+            {
+                if (use_pbc)
+                    c[d] = (c[d]+nc[d])%nc[d];
+                else if (c[d] < 0 || c[d] >= nc[d])
+                    inside = false;
+            }
+            if (!inside)
+                continue;
+            
+            for(int jt=head[(c[0]*nc[1] + c[1])*nc[2] + c[2]];jt>=0;jt=next[jt])
+            {
+                if (jt <= it || GRP[it] == GRP[jt])
+                    continue;
+                
+                float ddx = x[jt]-x[it], ddy = y[jt]-y[it], ddz = z[jt]-z[it];
+                if (use_pbc)
+                {
+                    ddx = min_image(ddx,box[0]);
+                    ddy = min_image(ddy,box[1]);
+                    ddz = min_image(ddz,box[2]);
+                }
+                if (ddx*ddx+ddy*ddy+ddz*ddz < rl2)
+                {
+                    PAIR p;
+                    const int a = min(GRP[it],GRP[jt]), b = max(GRP[it],GRP[jt]);
+                    p.key = (long long)a*NGRP + b;
+                    p.i = it;
+                    p.j = jt;
+                    pairs.push_back(p);
+                }
+            }
+        }
+    }
+    
+    sort(pairs.begin(),pairs.end());
+    
+    pair_i.resize(pairs.size());
+    pair_j.resize(pairs.size());
+    run_start.clear();
+    run_key.clear();
+    for(size_t p=0;p<pairs.size();p++)
+    {
+        pair_i[p] = pairs[p].i;
+        pair_j[p] = pairs[p].j;
+        if (p == 0 || pairs[p].key != pairs[p-1].key)
+        {
+            run_start.push_back((int)p);
+            run_key.push_back(pairs[p].key);
+        }
+    }
+    run_start.push_back((int)pairs.size());
+    
+    // each thread gets about the same number of pairs, split on run boundaries so that a run is counted by one thread only
+    const int nruns = (int)run_key.size();
+    thread_run.assign(nthreads+1,nruns);
+    thread_run[0] = 0;
+    int r = 0;
+    for(int t=1;t<nthreads;t++)
+    {
+        const size_t target = pairs.size()*t/nthreads;
+        while (r < nruns && (size_t)run_start[r] < target)
+            r++;
+        thread_run[t] = r;
+    }
+    run_count.assign(nruns+nthreads*PAD,0);
+    
+    memcpy(X0,x,NATOM*sizeof(float));
+    memcpy(Y0,y,NATOM*sizeof(float));
+    memcpy(Z0,z,NATOM*sizeof(float));
+    box0[0] = box[0]; box0[1] = box[1]; box0[2] = box[2];
+    
+    built = true;
+    nbuilds++;
+}
+
+/*
+ * Counts the runs of thread t : a run (group pair) is in contact for this frame if at least one of its atom pairs is within the cutoff.
+ */
+void CONTACT_MAP::count_runs(const int t, const float x[], const float y[], const float z[])
+{
+    unsigned long *cnt = &run_count[t*PAD];
+    
+    for(int r=thread_run[t];r<thread_run[t+1];r++)
+    {
+        for(int p=run_start[r];p<run_start[r+1];p++)
+        {
+            const int i = pair_i[p], j = pair_j[p];
+            float dx = x[j]-x[i], dy = y[j]-y[i], dz = z[j]-z[i];
+            if (use_pbc)
+            {
+                dx = min_image(dx,box[0]);
+                dy = min_image(dy,box[1]);
+                dz = min_image(dz,box[2]);
+            }
+            if (dx*dx+dy*dy+dz*dz < cut2)
+            {
+                cnt[r]++;
+                break;
+            }
+        }
+    }
+}
+
+void CONTACT_MAP::add_frame(const float x[], const float y[], const float z[], const double pbc[])
+{
+    use_pbc = (pbc != nullptr && pbc[0] > 0.0 && pbc[2] > 0.0 && pbc[5] > 0.0);
+    if (use_pbc)
+    {
+        // CHARMM stores the unit cell as the lower triangle of the box matrix : A, ., B, ., ., C
+        box[0] = (float)pbc[0];
+        box[1] = (float)pbc[2];
+        box[2] = (float)pbc[5];
+    }
+    
+    if (needs_rebuild(x,y,z))
+        build(x,y,z);
+    
+    if (nthreads > 1)
+    {
+        unique_lock<mutex> lock(pool_mtx);
+        cur_x = x;
+        cur_y = y;
+        cur_z = z;
+        pending = nthreads-1;
+        generation++;
+        pool_start.notify_all();
+    }
+    
+    count_runs(0,x,y,z);
+    
+    if (nthreads > 1)
+    {
+        unique_lock<mutex> lock(pool_mtx);
+        while (pending > 0)
+            pool_done.wait(lock);
+    }
+    
+    nframes++;
+}
+
+/*
+ * Loop of the worker thread t : waits for a new frame, counts its runs, and signals when done.
+ */
+void CONTACT_MAP::worker_loop(const int t)
+{
+    unsigned long seen = 0;
+    
+    for(;;)
+    {
+        const float *x,*y,*z;
+        {
+            unique_lock<mutex> lock(pool_mtx);
+            while (!stop && generation == seen)
+                pool_start.wait(lock);
+            if (stop)
+                return;
+            seen = generation;
+            x = cur_x;
+            y = cur_y;
+            z = cur_z;
+        }
+        
+        count_runs(t,x,y,z);
+        
+        {
+            unique_lock<mutex> lock(pool_mtx);
+            if (--pending == 0)
+                pool_done.notify_one();
+        }
+    }
+}
+
+/*
+ * Sparse output : only the group pairs found in contact at least once, a<b.
+ */
+void CONTACT_MAP::getFrequencies(vector<int>& a, vector<int>& b, vector<double>& freq) const
+{
+    map<long long,unsigned long> all(counts);
+    for(int t=0;t<nthreads;t++)
+        for(int r=thread_run[t];r<thread_run[t+1];r++)
+            if (run_count[r+t*PAD] > 0)
+                all[ run_key[r] ] += run_count[r+t*PAD];
+    
+    a.clear();
+    b.clear();
+    freq.clear();
+    for(map<long long,unsigned long>::const_iterator it=all.begin();it!=all.end();++it)
+    {
+        a.push_back((int)(it->first/NGRP));
+        b.push_back((int)(it->first%NGRP));
+        freq.push_back((double)it->second/(double)nframes);
+    }
+}
+
+/*
+ * Dense output : freq has to be a NGRP x NGRP array, initially filled with 0 ; it is filled symmetrically.
+ */
+void CONTACT_MAP::getFrequencies(ARRAY_2D<double>& freq) const
+{
+    vector<int> a,b;
+    vector<double> f;
+    getFrequencies(a,b,f);
+    
+    for(size_t it=0;it<f.size();it++)
+    {
+        freq(a[it],b[it]) = f[it];
+        freq(b[it],a[it]) = f[it];
+    }
+}
+
+int CONTACT_MAP::getNGRP() const {
+    return NGRP;
+}
+
+unsigned long CONTACT_MAP::getNframes() const {
+    return nframes;
+}
+
+unsigned long CONTACT_MAP::getNbuilds() const {
+    return nbuilds;
+}
+
+CONTACT_MAP::~CONTACT_MAP()
+{
+    {
+        unique_lock<mutex> lock(pool_mtx);
+        stop = true;
+        pool_start.notify_all();
+    }
+    for(size_t t=0;t<workers.size();t++)
+        workers[t].join();
+    
+    delete[] GRP;
+    delete[] X0;
+    delete[] Y0;
+    delete[] Z0;
+}
+
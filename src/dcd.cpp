@@ -58,10 +58,30 @@ void DCD::checkFortranIOerror(const char file[], const int line, const unsigned
 }
 
 
+/*
+ * Number of complete frames in a dcd file of fsize bytes whose header ends at hdr_end :
+ * the first frame stores the natom atoms, the next ones only the lnfreat free atoms (see DCD_R::read_oneFrame()).
+ */
+int DCD::count_frames(const long long fsize, const long long hdr_end, const int natom, const int lnfreat, const int qcrys)
+{
+    const long long crys = qcrys ? 2*sizeof(unsigned int)+sizeof(double)*6 : 0;
+    const long long first_frame = crys + 3*(2*sizeof(unsigned int)+sizeof(float)*(long long)natom);
+    const long long next_frame  = crys + 3*(2*sizeof(unsigned int)+sizeof(float)*(long long)lnfreat);
+    
+    if (fsize < hdr_end + first_frame)
+        return 0;
+    
+    return (int)(1 + (fsize - hdr_end - first_frame)/next_frame);
+}
+
 int DCD::getNFILE() const {
     return NFILE;
 }
 
+int DCD::getNFRAMES() const {
+    return NFRAMES;
+}
+
 const float* DCD::getZ() const {
     return Z;
 }
@@ -0,0 +1,354 @@
+/*
+ *  read_dcd : c++ class + main file example for reading a CHARMM dcd file
+ *  Copyright (C) 2013  Florent Hedin
+ *  
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "dcd_cache.hpp"
+
+using namespace std;
+
+#ifdef __linux__
+static const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+#endif
+
+DCD_CACHE::DCD_CACHE(DCD_R &_dcd, const size_t budget, const int sel[], const int nsel, const int _chunk_frames) : dcd(_dcd)
+{
+    // a truncated dcd (e.g. simulation still running or killed) has less frames than announced in its header
+    NFILE = dcd.getNFILE();
+    if (NFILE <= 0 || NFILE > dcd.getNFRAMES())
+        NFILE = dcd.getNFRAMES();
+    
+    // in free atoms only mode X Y Z of the reader keep the first frame : the free atoms view is stored instead
+    free_only = dcd.isFreeAtomsOnly();
+    NSRC = free_only ? dcd.getLNFREAT() : dcd.getNATOM();
+    
+    if (sel != nullptr && nsel > 0)
+    {
+        for(int it=0;it<nsel;it++)
+        {
+            if (sel[it] < 0 || sel[it] >= NSRC)
+            {
+                cerr << "Error when creating a DCD_CACHE : selected atom index " << sel[it] << " is not in [0," << NSRC << ")." << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        NSEL = nsel;
+        SEL = new int[NSEL];
+        memcpy(SEL,sel,NSEL*sizeof(int));
+    }
+    else
+    {
+        NSEL = NSRC;
+        SEL = nullptr;
+    }
+    
+    // pbc first then X Y Z ; rounded to a cache line so that each frame starts aligned
+    frame_bytes = sizeof(double)*6 + 3*sizeof(float)*NSEL;
+    frame_bytes = (frame_bytes + 63) & ~((size_t)63);
+    
+    if (budget < frame_bytes)
+    {
+        cerr << "Error when creating a DCD_CACHE : memory budget of " << budget << " bytes is smaller than one frame (" << frame_bytes << " bytes)." << endl;
+        exit(EXIT_FAILURE);
+    }
+    
+    /*
+     * If the whole trajectory fits in the budget there is a single chunk containing all the frames.
+     * Otherwise as many chunks of chunk_frames frames as possible are kept in memory.
+     */
+    if ((size_t)NFILE*frame_bytes <= budget)
+    {
+        chunk_frames = (NFILE > 0) ? NFILE : 1;
+        nchunks = 1;
+        nslots = 1;
+    }
+    else
+    {
+        chunk_frames = (_chunk_frames > 0) ? _chunk_frames : 1;
+        if ((size_t)chunk_frames*frame_bytes > budget)
+            chunk_frames = (int)(budget/frame_bytes);
+        nchunks = (NFILE + chunk_frames - 1)/chunk_frames;
+        nslots = (int)(budget/((size_t)chunk_frames*frame_bytes));
+    }
+    
+    arena_bytes = (size_t)nslots*chunk_frames*frame_bytes;
+    alloc_arena();
+    
+    slot_chunk = new int[nslots];
+    slot_stamp = new unsigned long[nslots];
+    chunk_slot = new int[nchunks];
+    for(int s=0;s<nslots;s++)
+    {
+        slot_chunk[s] = -1;
+        slot_stamp[s] = 0;
+    }
+    for(int c=0;c<nchunks;c++)
+        chunk_slot[c] = -1;
+    clock = 0;
+    
+    dcd.seek_frame(0);
+    next_file_frame = 0;
+    
+    // fill all the slots in order : a first sequential pass then only finds resident chunks
+    for(int c=0;c<nchunks && c<nslots;c++)
+        load_chunk(c,c);
+    
+    current = -1;
+    X = Y = Z = nullptr;
+    pbc = nullptr;
+}
+
+/*
+ * The arena is allocated with mmap so that huge pages can be used : explicit huge pages (MAP_HUGETLB) if the system
+ * has some reserved, otherwise transparent huge pages are requested with madvise.
+ * On other systems or if mmap fails a new[] is used, 63 bytes larger so that the arena can be aligned on 64 bytes.
+ */
+void DCD_CACHE::alloc_arena()
+{
+    arena = nullptr;
+    arena_raw = nullptr;
+    arena_mmap = false;
+    
+#ifdef __linux__
+    if (arena_bytes >= HUGE_PAGE_SIZE)
+    {
+        size_t hbytes = (arena_bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void *p = mmap(nullptr,hbytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if (p == MAP_FAILED)
+        {
+            p = mmap(nullptr,hbytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+#ifdef MADV_HUGEPAGE
+            if (p != MAP_FAILED)
+                madvise(p,hbytes,MADV_HUGEPAGE);
+#endif
+        }
+        if (p != MAP_FAILED)
+        {
+            arena = (char*)p;
+            arena_bytes = hbytes;
+            arena_mmap = true;
+            return;
+        }
+    }
+#endif
+    
+    try
+    {
+        arena_raw = new char[arena_bytes + 63];
+        arena = (char*)(((uintptr_t)arena_raw + 63) & ~((uintptr_t)63));
+    }
+    catch(std::exception& e)
+    {
+        cerr << "Error while allocating internal memory for a DCD_CACHE : " << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void DCD_CACHE::free_arena()
+{
+#ifdef __linux__
+    if (arena_mmap)
+    {
+        munmap(arena,arena_bytes);
+        return;
+    }
+#endif
+    delete[] arena_raw;
+}
+
+/*
+ * Reads the frames of a chunk from the dcd file and stores them (only the selected atoms) in a slot of the arena.
+ */
+void DCD_CACHE::load_chunk(const int chunk, const int slot)
+{
+    const int first = chunk*chunk_frames;
+    const int last  = (first + chunk_frames < NFILE) ? first + chunk_frames : NFILE;
+    
+    if (dcd.isFreeAtomsOnly() != free_only)
+    {
+        cerr << "Error when reading frames for a DCD_CACHE : the free atoms only mode of the reader changed since the cache was created." << endl;
+        exit(EXIT_FAILURE);
+    }
+    
+    if (next_file_frame != first)
+        dcd.seek_frame(first);
+    
+    char *p = arena + (size_t)slot*chunk_frames*frame_bytes;
+    for(int f=first;f<last;f++)
+    {
+        dcd.read_oneFrame();
+        
+        double *fpbc = (double*)p;
+        float  *fx = (float*)(p + sizeof(double)*6);
+        float  *fy = fx + NSEL;
+        float  *fz = fy + NSEL;
+        
+        memcpy(fpbc,dcd.getPbc(),sizeof(double)*6);
+        
+        const float *x = free_only ? dcd.getFreeX() : dcd.getX();
+        const float *y = free_only ? dcd.getFreeY() : dcd.getY();
+        const float *z = free_only ? dcd.getFreeZ() : dcd.getZ();
+        if (SEL == nullptr)
+        {
+            memcpy(fx,x,NSEL*sizeof(float));
+            memcpy(fy,y,NSEL*sizeof(float));
+            memcpy(fz,z,NSEL*sizeof(float));
+        }
+        else
+        {
+            for(int it=0;it<NSEL;it++)
+            {
+                fx[it] = x[ SEL[it] ];
+                fy[it] = y[ SEL[it] ];
+                fz[it] = z[ SEL[it] ];
+            }
+        }
+        
+        p += frame_bytes;
+    }
+    next_file_frame = last;
+    
+    if (slot_chunk[slot] >= 0)
+        chunk_slot[ slot_chunk[slot] ] = -1;
+    slot_chunk[slot] = chunk;
+    chunk_slot[chunk] = slot;
+    slot_stamp[slot] = ++clock;
+}
+
+/*
+ * Returns the slot storing the chunk, loading it if it is not in memory : in the last slot for a sequential pass,
+ * otherwise in place of the least recently used chunk.
+ */
+int DCD_CACHE::acquire_chunk(const int chunk, const bool sequential)
+{
+    int slot = chunk_slot[chunk];
+    
+    if (slot < 0)
+    {
+        if (sequential && nslots > 1)
+            slot = nslots-1;
+        else
+        {
+            slot = 0;
+            for(int s=1;s<nslots;s++)
+                if (slot_stamp[s] < slot_stamp[slot])
+                    slot = s;
+        }
+        load_chunk(chunk,slot);
+    }
+    else
+        slot_stamp[slot] = ++clock;
+    
+    return slot;
+}
+
+void DCD_CACHE::expose_frame(const int frame, const bool sequential)
+{
+    if (frame < 0 || frame >= NFILE)
+    {
+        cerr << "Error when reading frame " << frame << " from a DCD_CACHE : only " << NFILE << " frames are available." << endl;
+        exit(EXIT_FAILURE);
+    }
+    
+    const int chunk = frame/chunk_frames;
+    const int slot = (nslots == 1 && nchunks == 1) ? 0 : acquire_chunk(chunk,sequential);
+    
+    const char *p = arena + ((size_t)slot*chunk_frames + (frame - chunk*chunk_frames))*frame_bytes;
+    pbc = (const double*)p;
+    X = (const float*)(p + sizeof(double)*6);
+    Y = X + NSEL;
+    Z = Y + NSEL;
+    
+    current = frame;
+}
+
+/*
+ * Makes the given frame (0 is the first one) available through getX(), getY(), getZ() and getPbc().
+ */
+void DCD_CACHE::load_frame(const int frame)
+{
+    expose_frame(frame,false);
+}
+
+/*
+ * Same use as DCD_R::read_oneFrame() : each call moves to the next frame. Call rewind() before a new pass.
+ */
+void DCD_CACHE::read_oneFrame()
+{
+    expose_frame(current+1,true);
+}
+
+void DCD_CACHE::rewind()
+{
+    current = -1;
+}
+
+bool DCD_CACHE::isResident() const {
+    return nchunks <= nslots;
+}
+
+int DCD_CACHE::getNFILE() const {
+    return NFILE;
+}
+
+int DCD_CACHE::getNATOM() const {
+    return NSEL;
+}
+
+int DCD_CACHE::getCurrentFrame() const {
+    return current;
+}
+
+const float* DCD_CACHE::getX() const {
+    return X;
+}
+
+const float* DCD_CACHE::getY() const {
+    return Y;
+}
+
+const float* DCD_CACHE::getZ() const {
+    return Z;
+}
+
+const double* DCD_CACHE::getPbc() const {
+    return pbc;
+}
+
+const int* DCD_CACHE::getSEL() const {
+    return SEL;
+}
+
+DCD_CACHE::~DCD_CACHE()
+{
+    free_arena();
+    
+    delete[] SEL;
+    delete[] slot_chunk;
+    delete[] slot_stamp;
+    delete[] chunk_slot;
+}
+
@@ -0,0 +1,327 @@
+/*
+ *  read_dcd : c++ class + main file example for reading a CHARMM dcd file
+ *  Copyright (C) 2013  Florent Hedin
+ *  
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include "dcd.hpp"
+#include "dcd_catalog.hpp"
+
+using namespace std;
+
+namespace
+{
+    const char CSV_HEADER[] = "path,size,mtime,NATOM,NFILE,NFRAMES,NSAVC,DELTA4,QCRYS,CHARMV,FROZAT,TITLE";
+    
+    string csv_quote(const string& s)
+    {
+        string q = "\"";
+        for(size_t it=0;it<s.size();it++)
+        {
+            if (s[it] == '"')
+                q += '"';
+            q += s[it];
+        }
+        return q + "\"";
+    }
+    
+    // splits one line of the CSV index, fields may be quoted with "" for a quote inside
+    vector<string> csv_split(const string& line)
+    {
+        vector<string> fields(1);
+        bool quoted = false;
+        for(size_t it=0;it<line.size();it++)
+        {
+            const char c = line[it];
+            if (quoted)
+            {
+                if (c == '"' && it+1 < line.size() && line[it+1] == '"')
+                {
+                    fields.back() += '"';
+                    it++;
+                }
+                else if (c == '"')
+                    quoted = false;
+                else
+                    fields.back() += c;
+            }
+            else if (c == '"')
+                quoted = true;
+            else if (c == ',')
+                fields.push_back(string());
+            else
+                fields.back() += c;
+        }
+        return fields;
+    }
+    
+    bool file_stat(const string& path, long long& size, long long& mtime)
+    {
+        struct stat st;
+        if (stat(path.c_str(),&st) != 0)
+            return false;
+        size = (long long)st.st_size;
+        mtime = (long long)st.st_mtime;
+        return true;
+    }
+    
+    // reads one fortran marker and checks it has the expected value, see DCD::checkFortranIOerror for details
+    bool read_marker(ifstream& f, const unsigned int expected)
+    {
+        unsigned int fortcheck;
+        f.read((char*)&fortcheck,sizeof(unsigned int));
+        return f.good() && fortcheck == expected;
+    }
+}
+
+DCD_CATALOG::DCD_CATALOG()
+{
+}
+
+/*
+ * Reads only the header of a dcd file (same layout as in DCD_R::read_header()) ; the list of free atoms is skipped.
+ * Returns false if the file is not a valid dcd.
+ */
+bool DCD_CATALOG::scan_header(const string& path, DCD_CATALOG_ENTRY& e)
+{
+    ifstream f(path.c_str(),ios::in|ios::binary);
+    if (!f.is_open())
+        return false;
+    
+    char HDR[4];
+    int  ICNTRL[20];
+    const unsigned int hdrsiz = sizeof(char)*4 + sizeof(int)*20;
+    
+    if (!read_marker(f,hdrsiz))
+        return false;
+    f.read(HDR,sizeof(char)*4);
+    f.read((char*)ICNTRL,sizeof(int)*20);
+    if (!read_marker(f,hdrsiz))
+        return false;
+    
+    e.NFILE  = ICNTRL[0];
+    e.NSAVC  = ICNTRL[2];
+    e.FROZAT = ICNTRL[8];
+    e.DELTA4 = ICNTRL[9];
+    e.QCRYS  = ICNTRL[10];
+    e.CHARMV = ICNTRL[19];
+    
+    unsigned int fortcheck1;
+    int NTITLE;
+    f.read((char*)&fortcheck1,sizeof(unsigned int));
+    f.read((char*)&NTITLE,sizeof(int));
+    if (!f.good() || NTITLE < 0 || fortcheck1 != sizeof(int) + 80*(unsigned int)NTITLE)
+        return false;
+    
+    e.TITLE.clear();
+    char line[80];
+    for(int it=0;it<NTITLE;it++)
+    {
+        f.read(line,sizeof(char)*80);
+        
+        int len = 80;
+        while (len > 0 && (line[len-1] == ' ' || line[len-1] == '\0'))
+            len--;
+        
+        if (it > 0)
+            e.TITLE += " | ";
+        for(int c=0;c<len;c++)
+            e.TITLE += (line[c] >= 32 && line[c] < 127) ? line[c] : ' ';
+    }
+    if (!read_marker(f,fortcheck1))
+        return false;
+    
+    if (!read_marker(f,sizeof(int)))
+        return false;
+    f.read((char*)&e.NATOM,sizeof(int));
+    if (!read_marker(f,sizeof(int)) || e.NATOM <= 0)
+        return false;
+    
+    const int LNFREAT = e.NATOM - e.FROZAT;
+    if (LNFREAT <= 0)
+        return false;
+    
+    // list of free atoms : skipped
+    if (LNFREAT != e.NATOM)
+        f.seekg(2*sizeof(unsigned int) + sizeof(int)*LNFREAT,ios::cur);
+    
+    if (!f.good())
+        return false;
+    
+    e.NFRAMES = DCD::count_frames(e.size,(long long)f.tellg(),e.NATOM,LNFREAT,e.QCRYS);
+    
+    return true;
+}
+
+/*
+ * Loads an index previously written by DCD_CATALOG::save() ; returns false if the file can not be read.
+ */
+bool DCD_CATALOG::load(const char filename[])
+{
+    ifstream f(filename);
+    if (!f.is_open())
+        return false;
+    
+    string line;
+    getline(f,line);
+    if (line != CSV_HEADER)
+    {
+        cerr << "Error when reading dcd catalog '" << filename << "' : unknown format." << endl;
+        return false;
+    }
+    
+    while (getline(f,line))
+    {
+        vector<string> v = csv_split(line);
+        if (v.size() != 12)
+            continue;
+        
+        DCD_CATALOG_ENTRY e;
+        e.path    = v[0];
+        e.size    = atoll(v[1].c_str());
+        e.mtime   = atoll(v[2].c_str());
+        e.NATOM   = atoi(v[3].c_str());
+        e.NFILE   = atoi(v[4].c_str());
+        e.NFRAMES = atoi(v[5].c_str());
+        e.NSAVC   = atoi(v[6].c_str());
+        e.DELTA4  = atoi(v[7].c_str());
+        e.QCRYS   = atoi(v[8].c_str());
+        e.CHARMV  = atoi(v[9].c_str());
+        e.FROZAT  = atoi(v[10].c_str());
+        e.TITLE   = v[11];
+        entries[e.path] = e;
+    }
+    
+    return true;
+}
+
+/*
+ * The index is written to filename.tmp then renamed : the previous index stays intact if the writing fails.
+ */
+bool DCD_CATALOG::save(const char filename[]) const
+{
+    const string tmpname = string(filename) + ".tmp";
+    
+    ofstream f(tmpname.c_str());
+    if (!f.is_open())
+    {
+        cerr << "Error when writing dcd catalog '" << tmpname << "'." << endl;
+        return false;
+    }
+    
+    f << CSV_HEADER << '\n';
+    for(map<string,DCD_CATALOG_ENTRY>::const_iterator it=entries.begin();it!=entries.end();++it)
+    {
+        const DCD_CATALOG_ENTRY& e = it->second;
+        f << csv_quote(e.path) << ',' << e.size << ',' << e.mtime << ','
+          << e.NATOM << ',' << e.NFILE << ',' << e.NFRAMES << ',' << e.NSAVC << ','
+          << e.DELTA4 << ',' << e.QCRYS << ',' << e.CHARMV << ',' << e.FROZAT << ','
+          << csv_quote(e.TITLE) << '\n';
+    }
+    
+    f.close();
+    if (!f.good() || rename(tmpname.c_str(),filename) != 0)
+    {
+        cerr << "Error when writing dcd catalog '" << filename << "'." << endl;
+        remove(tmpname.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+/*
+ * Adds the given files to the index : files already indexed with the same size and modification time are not read again.
+ * Files which do not exist anymore or are not valid dcds are removed from the index.
+ * Returns the number of headers read.
+ */
+int DCD_CATALOG::update(const vector<string>& files, const int nthreads)
+{
+    vector<DCD_CATALOG_ENTRY> todo;
+    for(size_t it=0;it<files.size();it++)
+    {
+        DCD_CATALOG_ENTRY e;
+        e.path = files[it];
+        if (!file_stat(e.path,e.size,e.mtime))
+        {
+            cerr << "Warning : can not access '" << e.path << "', removed from the dcd catalog." << endl;
+            entries.erase(e.path);
+            continue;
+        }
+        
+        map<string,DCD_CATALOG_ENTRY>::const_iterator old = entries.find(e.path);
+        if (old != entries.end() && old->second.size == e.size && old->second.mtime == e.mtime)
+            continue;
+        
+        todo.push_back(e);
+    }
+    
+    vector<char> valid(todo.size(),0);
+    atomic<size_t> next_file(0);
+    
+    // each worker takes the next file to read until none is left
+    auto worker = [&]()
+    {
+        for(size_t it=next_file++;it<todo.size();it=next_file++)
+            valid[it] = scan_header(todo[it].path,todo[it]) ? 1 : 0;
+    };
+    
+    const int nworkers = (nthreads > 1) ? nthreads : 1;
+    vector<thread> pool;
+    for(int t=1;t<nworkers;t++)
+        pool.push_back(thread(worker));
+    worker();
+    for(size_t t=0;t<pool.size();t++)
+        pool[t].join();
+    
+    for(size_t it=0;it<todo.size();it++)
+    {
+        if (valid[it])
+            entries[ todo[it].path ] = todo[it];
+        else
+        {
+            cerr << "Warning : '" << todo[it].path << "' is not a valid dcd, removed from the dcd catalog." << endl;
+            entries.erase(todo[it].path);
+        }
+    }
+    
+    return (int)todo.size();
+}
+
+const DCD_CATALOG_ENTRY* DCD_CATALOG::find(const string& path) const
+{
+    map<string,DCD_CATALOG_ENTRY>::const_iterator it = entries.find(path);
+    return (it != entries.end()) ? &(it->second) : nullptr;
+}
+
+size_t DCD_CATALOG::size() const {
+    return entries.size();
+}
+
+DCD_CATALOG::~DCD_CATALOG()
+{
+}
+
@@ -22,6 +22,10 @@
 #include <fstream>
 #include <iostream>
 
+#ifdef __AVX512F__
+#include <immintrin.h>
+#endif
+
 #include "dcd_r.hpp"
 
 using namespace std;
@@ -41,6 +45,21 @@ DCD_R::DCD_R(const char filename[])
     } 
     
     dcd_first_read=true;
+    
+    frame_buf=nullptr;
+    first_frame_pos=0;
+    
+    nruns=nsingle=0;
+    run_src=run_dst=run_len=nullptr;
+    single_src=single_dst=nullptr;
+    
+    free_only=false;
+    free_buf=nullptr;
+    freeX=freeY=freeZ=nullptr;
+
+    decode_frame=nullptr;
+    first_decoder=nullptr;
+    reselect_decoder=nullptr;
 }
 
 void DCD_R::alloc()
@@ -49,6 +68,109 @@ void DCD_R::alloc()
     Y=new float[NATOM];
     Z=new float[NATOM];
     pbc[0]=pbc[1]=pbc[2]=pbc[3]=pbc[4]=pbc[5]=0.0;
+    
+    // the largest frame is one with all the NATOM coordinates (first frame if there are frozen atoms)
+    frame_buf=new char[2*sizeof(unsigned int)+sizeof(double)*6 + 3*(2*sizeof(unsigned int)+sizeof(float)*NATOM)];
+    
+    if (LNFREAT != NATOM)
+        free_buf=new float[3*LNFREAT];
+    else
+    {
+        freeX=X;
+        freeY=Y;
+        freeZ=Z;
+    }
+}
+
+/*
+ * Free atoms are often stored in long contiguous blocks (e.g. all atoms except fixed lipids) : each block of at least
+ * MIN_RUN atoms becomes a memcpy, the other atoms are scattered individually.
+ */
+void DCD_R::build_scatter_runs()
+{
+    const int MIN_RUN=8;
+    
+    run_src=new int[LNFREAT];
+    run_dst=new int[LNFREAT];
+    run_len=new int[LNFREAT];
+    single_src=new int[LNFREAT];
+    single_dst=new int[LNFREAT];
+    
+    nruns=nsingle=0;
+    int it=0;
+    while(it<LNFREAT)
+    {
+        int len=1;
+        while(it+len<LNFREAT && FREEAT[it+len]==FREEAT[it]+len)
+            len++;
+        
+        if(len>=MIN_RUN)
+        {
+            run_src[nruns]=it;
+            run_dst[nruns]=FREEAT[it]-1;
+            run_len[nruns]=len;
+            nruns++;
+        }
+        else
+        {
+            for(int k=it;k<it+len;k++)
+            {
+                single_src[nsingle]=k;
+                single_dst[nsingle]=FREEAT[k]-1;
+                nsingle++;
+            }
+        }
+        it+=len;
+    }
+}
+
+/*
+ * Equivalent of dst[ FREEAT[it]-1 ] = tmp[it] for all the free atoms, using the runs built by DCD_R::build_scatter_runs().
+ * AVX2 has no scatter instruction so only AVX-512 gets a vector path for the isolated atoms.
+ */
+void DCD_R::scatter_free(const float tmp[], float dst[]) const
+{
+    for(int r=0;r<nruns;r++)
+        memcpy(dst+run_dst[r],tmp+run_src[r],run_len[r]*sizeof(float));
+    
+    int it=0;
+#ifdef __AVX512F__
+    for(;it+16<=nsingle;it+=16)
+    {
+        const __m512i src=_mm512_loadu_si512((const void*)(single_src+it));
+        const __m512i idx=_mm512_loadu_si512((const void*)(single_dst+it));
+        const __m512  val=_mm512_mask_i32gather_ps(_mm512_setzero_ps(),0xFFFF,src,tmp,sizeof(float));
+        _mm512_i32scatter_ps(dst,idx,val,sizeof(float));
+    }
+#endif
+    for(;it<nsingle;it++)
+        dst[ single_dst[it] ] = tmp[ single_src[it] ];
+}
+
+/*
+ * The first frame stores all the atoms : the free ones are copied to free_buf for the free atoms view.
+ */
+void DCD_R::gather_first_free()
+{
+    float *fx=free_buf;
+    float *fy=free_buf+LNFREAT;
+    float *fz=free_buf+2*LNFREAT;
+    
+    for(int it=0;it<LNFREAT;it++)
+    {
+        fx[it] = X[ FREEAT[it]-1 ];
+        fy[it] = Y[ FREEAT[it]-1 ];
+        fz[it] = Z[ FREEAT[it]-1 ];
+    }
+    
+    freeX=fx;
+    freeY=fy;
+    freeZ=fz;
+}
+
+void DCD_R::select_decoder()
+{
+    set_decoder<0>();
 }
 
 void DCD_R::read_header()
@@ -113,79 +235,90 @@ void DCD_R::read_header()
         dcdf.read((char*)FREEAT,sizeof(int)*LNFREAT);
         dcdf.read((char*)&fortcheck2,sizeof(unsigned int));
         checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
+        
+        build_scatter_runs();
     }
     
     //allocate memory for storing coordinates (only one frame of the dcd is stored, so several (NFILE) calls to DCD_R::read_oneFrame() are necessary for reading the whole file).
     alloc();
-}
-
-void DCD_R::read_oneFrame()
-{
-    unsigned int fortcheck1,fortcheck2;
     
-    int siz=(dcd_first_read) ? NATOM : LNFREAT ;
+    first_frame_pos = dcdf.tellg();
     
-    float *tmpX=new float[siz];
-    float *tmpY=new float[siz];
-    float *tmpZ=new float[siz];
+    dcdf.seekg(0,ios::end);
+    NFRAMES = count_frames((long long)dcdf.tellg(),(long long)first_frame_pos,NATOM,LNFREAT,QCRYS);
+    dcdf.seekg(first_frame_pos);
     
-    if (QCRYS)
+    select_decoder();
+}
+
+/*
+ * Size in bytes of a frame storing ncrd coordinates per dimension (NATOM for the first frame, LNFREAT for the other ones)
+ */
+size_t DCD_R::frame_size(const int ncrd) const
+{
+    return (QCRYS ? 2*sizeof(unsigned int)+sizeof(double)*6 : 0) + 3*(2*sizeof(unsigned int)+sizeof(float)*ncrd);
+}
+
+/*
+ * Moves the file to the given frame (0 is the first one) so that the next call to DCD_R::read_oneFrame() reads it.
+ * With frozen atoms their coordinates are only stored in the first frame : it is read first if it was never read before.
+ */
+void DCD_R::seek_frame(const int frame)
+{
+    if (frame == 0)
     {
-        dcdf.read((char*)&fortcheck1,sizeof(unsigned int));
-        dcdf.read((char*)pbc,sizeof(double)*6);
-        dcdf.read((char*)&fortcheck2,sizeof(unsigned int));
-        checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
+        dcdf.seekg(first_frame_pos);
+        dcd_first_read=true;
+        decode_frame=first_decoder;
+        return;
     }
     
-    // X
-    dcdf.read((char*)&fortcheck1,sizeof(unsigned int));
-    dcdf.read((char*)tmpX,sizeof(float)*siz);
-    dcdf.read((char*)&fortcheck2,sizeof(unsigned int));
-    checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
-    
-    // Y
-    dcdf.read((char*)&fortcheck1,sizeof(unsigned int));
-    dcdf.read((char*)tmpY,sizeof(float)*siz);
-    dcdf.read((char*)&fortcheck2,sizeof(unsigned int));
-    checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
-    
-    // Z
-    dcdf.read((char*)&fortcheck1,sizeof(unsigned int));
-    dcdf.read((char*)tmpZ,sizeof(float)*siz);
-    dcdf.read((char*)&fortcheck2,sizeof(unsigned int));
-    checkFortranIOerror(__FILE__,__LINE__,fortcheck1,fortcheck2);
-    
-    if(dcd_first_read)
-    {
-        memcpy(X,tmpX,NATOM*sizeof(float));
-        memcpy(Y,tmpY,NATOM*sizeof(float));
-        memcpy(Z,tmpZ,NATOM*sizeof(float));
-    }
-    else
+    if (dcd_first_read && LNFREAT != NATOM)
     {
-        if (LNFREAT != NATOM)
-        {
-            for(int it=0;it<siz;it++)
-            {
-                X[ FREEAT[it]-1 ] = tmpX[it];
-                Y[ FREEAT[it]-1 ] = tmpY[it];
-                Z[ FREEAT[it]-1 ] = tmpZ[it];
-            }
-        }
-        else
-        {
-            memcpy(X,tmpX,NATOM*sizeof(float));
-            memcpy(Y,tmpY,NATOM*sizeof(float));
-            memcpy(Z,tmpZ,NATOM*sizeof(float));
-        }
+        dcdf.seekg(first_frame_pos);
+        read_oneFrame();
     }
     
-    if(dcd_first_read)
-        dcd_first_read=false;
+    dcdf.seekg(first_frame_pos + (std::streamoff)(frame_size(NATOM) + (frame-1)*frame_size(LNFREAT)));
+}
+
+/*
+ * The frame decoder was selected once at the end of DCD_R::read_header() (see DCD_R::select_decoder()),
+ * so reading a frame is a single call without any test on QCRYS or on frozen atoms.
+ */
+void DCD_R::read_oneFrame()
+{
+    (this->*decode_frame)();
+}
+
+/*
+ * For analyses of the mobile atoms only : the scatter of the free atoms to X Y Z is skipped and their coordinates
+ * are accessed with getFreeX(), getFreeY(), getFreeZ() (arrays of size LNFREAT, in the order of FREEAT).
+ * Can be called before or after read_header() : in the latter case the decoder is selected again, with the same
+ * fixed number of atoms if DCD_R::use_fixed_natom() was used.
+ */
+void DCD_R::set_free_atoms_only(const bool _free_only)
+{
+    free_only=_free_only;
     
-    delete[] tmpX;
-    delete[] tmpY;
-    delete[] tmpZ;
+    if (reselect_decoder != nullptr)
+        (this->*reselect_decoder)();
+}
+
+bool DCD_R::isFreeAtomsOnly() const {
+    return free_only;
+}
+
+const float* DCD_R::getFreeX() const {
+    return freeX;
+}
+
+const float* DCD_R::getFreeY() const {
+    return freeY;
+}
+
+const float* DCD_R::getFreeZ() const {
+    return freeZ;
 }
 
 void DCD_R::printHeader() const
@@ -219,5 +352,14 @@ DCD_R::~DCD_R()
     delete[] X;
     delete[] Y;
     delete[] Z;
+    
+    delete[] frame_buf;
+    delete[] free_buf;
+    
+    delete[] run_src;
+    delete[] run_dst;
+    delete[] run_len;
+    delete[] single_src;
+    delete[] single_dst;
 }
 
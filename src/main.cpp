@@ -34,6 +34,9 @@ int main(int argc, char* argv[])
     dcdf.read_header();
     dcdf.printHeader();
     
+    // optional : for a tiny system of known size, e.g. 3 atoms, use decoders specialised on the number of atoms
+    // dcdf.use_fixed_natom<3>();
+    
     const float *x,*y,*z;
     
     // in this loop the coordinates are read frame by frame
@@ -0,0 +1,111 @@
+/*
+ *  read_dcd : c++ class + main file example for reading a CHARMM dcd file
+ *  Copyright (C) 2013  Florent Hedin
+ *  
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dcd_catalog.hpp"
+
+using namespace std;
+
+static void usage(const char prog[])
+{
+    cerr << "Usage : " << prog << " index.csv [-j nthreads] [-l list_of_files] [file1.dcd file2.dcd ...]" << endl;
+    cerr << "        " << prog << " index.csv -q file.dcd" << endl;
+    cerr << "Creates or updates the index of the headers of the given dcd files ; with -q prints the entry of one file." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    const char *index = argv[1];
+    int nthreads = 8;
+    const char *query = nullptr;
+    vector<string> files;
+    
+    for(int i=2;i<argc;i++)
+    {
+        if (!strcmp(argv[i],"-j") && i+1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i],"-q") && i+1 < argc)
+            query = argv[++i];
+        else if (!strcmp(argv[i],"-l") && i+1 < argc)
+        {
+            ifstream list(argv[++i]);
+            string line;
+            while (getline(list,line))
+                if (!line.empty())
+                    files.push_back(line);
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        else
+            files.push_back(argv[i]);
+    }
+    
+    // an existing file which is not a catalog (e.g. a dcd given by mistake as first argument) must never be overwritten
+    DCD_CATALOG cat;
+    ifstream existing(index);
+    if (existing.is_open())
+    {
+        existing.close();
+        if (!cat.load(index))
+        {
+            cerr << "'" << index << "' exists but is not a dcd catalog : not modified." << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    if (query != nullptr)
+    {
+        const DCD_CATALOG_ENTRY *e = cat.find(query);
+        if (e == nullptr)
+        {
+            cerr << "'" << query << "' is not in the dcd catalog '" << index << "'." << endl;
+            return EXIT_FAILURE;
+        }
+        cout << "NATOM :\t"   << e->NATOM   << endl;
+        cout << "NFILE :\t"   << e->NFILE   << endl;
+        cout << "NFRAMES :\t" << e->NFRAMES << endl;
+        cout << "NSAVC :\t"   << e->NSAVC   << endl;
+        cout << "DELTA4 :\t"  << e->DELTA4  << endl;
+        cout << "QCRYS :\t"   << e->QCRYS   << endl;
+        cout << "CHARMV :\t"  << e->CHARMV  << endl;
+        cout << "FROZAT :\t"  << e->FROZAT  << endl;
+        cout << "TITLE :\t"   << e->TITLE   << endl;
+        return EXIT_SUCCESS;
+    }
+    
+    const int nread = cat.update(files,nthreads);
+    cout << nread << " headers read, " << cat.size() << " files in the dcd catalog." << endl;
+    
+    return cat.save(index) ? EXIT_SUCCESS : EXIT_FAILURE;
+}